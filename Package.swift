@@ -34,9 +34,17 @@ let package = Package(
                 "mssilk",
                 "mswebrtc",
                 "ortp",
-                "ZXing"
+                "ZXing",
+                "LogRing"
             ]
         ),
+        .target(
+            name: "LogRing"
+        ),
+        .testTarget(
+            name: "linphoneswTests",
+            dependencies: ["linphonesw"]
+        ),
         .binaryTarget(
             name: "linphone",
             path: "XCFrameworks/linphone.xcframework"
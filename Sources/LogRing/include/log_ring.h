@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2010-2020 Belledonne Communications SARL.
+ *
+ * This file is part of linphone-iphone
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bounded lock-free multi-producer queue of pointers, used by LogCollector to hand log
+ * records to its writer thread. Push and pop never block and never allocate.
+ */
+typedef struct _LogRing LogRing;
+
+/* The capacity is rounded up to a power of two. */
+LogRing *log_ring_new(size_t capacity);
+
+/* The ring must be empty, or the remaining pointers are leaked. */
+void log_ring_destroy(LogRing *ring);
+
+size_t log_ring_capacity(const LogRing *ring);
+
+/*
+ * Queues an item. Returns false and counts it as dropped when the ring is full.
+ * When queued, *count is set to the number of items in the ring including this one.
+ */
+bool log_ring_push(LogRing *ring, void *item, size_t *count);
+
+/* Returns the oldest item, or NULL when the ring is empty. */
+void *log_ring_pop(LogRing *ring);
+
+uint64_t log_ring_dropped(const LogRing *ring);
+
+void log_ring_add_dropped(LogRing *ring, uint64_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LOG_RING_H */
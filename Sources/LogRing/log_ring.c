@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2010-2020 Belledonne Communications SARL.
+ *
+ * This file is part of linphone-iphone
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "log_ring.h"
+
+/*
+ * Each cell carries a sequence number telling whose turn it is: a cell is free for the producer
+ * at position p when its sequence is p, and holds an item for the consumer at position p when
+ * its sequence is p + 1. Producers claim positions with a compare and swap on the tail, so a
+ * producer never waits for another one.
+ */
+typedef struct {
+	atomic_size_t sequence;
+	void *item;
+} LogRingCell;
+
+struct _LogRing {
+	LogRingCell *cells;
+	size_t mask;
+	/* The positions are on their own cache lines, producers and the consumer do not share them. */
+	_Alignas(64) atomic_size_t tail;
+	_Alignas(64) atomic_size_t head;
+	_Alignas(64) atomic_uint_fast64_t dropped;
+};
+
+LogRing *log_ring_new(size_t capacity) {
+	size_t size = 2;
+	while (size < capacity)
+		size <<= 1;
+	LogRing *ring = aligned_alloc(64, (sizeof(LogRing) + 63) & ~(size_t)63);
+	if (!ring)
+		return NULL;
+	ring->cells = malloc(size * sizeof(LogRingCell));
+	if (!ring->cells) {
+		free(ring);
+		return NULL;
+	}
+	for (size_t i = 0; i < size; i++) {
+		atomic_init(&ring->cells[i].sequence, i);
+		ring->cells[i].item = NULL;
+	}
+	ring->mask = size - 1;
+	atomic_init(&ring->tail, 0);
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->dropped, 0);
+	return ring;
+}
+
+void log_ring_destroy(LogRing *ring) {
+	if (!ring)
+		return;
+	free(ring->cells);
+	free(ring);
+}
+
+size_t log_ring_capacity(const LogRing *ring) {
+	return ring->mask + 1;
+}
+
+bool log_ring_push(LogRing *ring, void *item, size_t *count) {
+	size_t position = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	for (;;) {
+		LogRingCell *cell = &ring->cells[position & ring->mask];
+		size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		intptr_t diff = (intptr_t)sequence - (intptr_t)position;
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&ring->tail, &position, position + 1, memory_order_relaxed,
+			                                          memory_order_relaxed)) {
+				cell->item = item;
+				atomic_store_explicit(&cell->sequence, position + 1, memory_order_release);
+				if (count)
+					*count = position + 1 - atomic_load_explicit(&ring->head, memory_order_relaxed);
+				return true;
+			}
+			/* position was reloaded by the failed compare and swap */
+		} else if (diff < 0) {
+			/* The cell still holds the item pushed one lap earlier: the ring is full. */
+			atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+			return false;
+		} else {
+			position = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+		}
+	}
+}
+
+void *log_ring_pop(LogRing *ring) {
+	size_t position = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	for (;;) {
+		LogRingCell *cell = &ring->cells[position & ring->mask];
+		size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		intptr_t diff = (intptr_t)sequence - (intptr_t)(position + 1);
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&ring->head, &position, position + 1, memory_order_relaxed,
+			                                          memory_order_relaxed)) {
+				void *item = cell->item;
+				cell->item = NULL;
+				atomic_store_explicit(&cell->sequence, position + ring->mask + 1, memory_order_release);
+				return item;
+			}
+		} else if (diff < 0) {
+			return NULL;
+		} else {
+			position = atomic_load_explicit(&ring->head, memory_order_relaxed);
+		}
+	}
+}
+
+uint64_t log_ring_dropped(const LogRing *ring) {
+	return atomic_load_explicit(&((LogRing *)ring)->dropped, memory_order_relaxed);
+}
+
+void log_ring_add_dropped(LogRing *ring, uint64_t count) {
+	atomic_fetch_add_explicit(&ring->dropped, count, memory_order_relaxed);
+}
@@ -0,0 +1,408 @@
+/*
+ * Copyright (c) 2010-2020 Belledonne Communications SARL.
+ *
+ * This file is part of linphone-iphone
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+import Foundation
+import SQLite3
+import linphonesw
+
+public enum CallHistoryStoreError: Error {
+    case sqlite(code: Int32, message: String)
+}
+
+/*
+ * A call log as stored in the history index. The full CallLog can be fetched
+ * back from the core with CallHistoryStore.callLog(for:).
+ */
+public struct CallHistoryEntry {
+    public let rowId: Int64
+    public let callId: String
+    public let refKey: String?
+    public let remoteAddress: String?
+    public let localAddress: String?
+    public let dir: Call.Dir
+    public let status: Call.Status
+    public let startDate: time_t
+    public let duration: Int
+    public let quality: Float
+    public let videoEnabled: Bool
+}
+
+/*
+ * Position of the last entry of a page, pass it back to get the next one.
+ * Pages are ordered by (startDate, rowId) descending, so the cursor stays valid
+ * while new calls are being added.
+ */
+public struct CallHistoryCursor {
+    public let startDate: time_t
+    public let rowId: Int64
+}
+
+public struct CallHistoryQuery {
+    public var dir: Call.Dir? = nil
+    public var statuses: [Call.Status]? = nil
+    public var remoteAddress: Address? = nil
+    public var since: time_t? = nil
+    public var until: time_t? = nil
+    public var limit: Int = 50
+
+    public init() {}
+}
+
+/*
+ * CallHistoryStore keeps an indexed copy of the core call history.
+ * linphone_core_get_call_logs() and friends return the whole history as a list, and lookups
+ * by call-id, ref-key or address walk it. The store mirrors every call log into an SQLite
+ * table indexed on those keys, so lookups, paged listing and counters are answered by
+ * the database instead of in memory.
+ */
+public class CallHistoryStore: CoreDelegate {
+    let db: OpaquePointer
+    let queue = DispatchQueue(label: "linphonesw.callhistory")
+    var statements: [String : OpaquePointer] = [:]
+    var statementsOrder: [String] = []
+    static let maxStatements = 16
+    weak var core: Core?
+
+    var logger: Logger? = nil
+
+    public init(path: String) throws {
+        var handle: OpaquePointer?
+        let flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX
+        let rc = sqlite3_open_v2(path, &handle, flags, nil)
+        guard rc == SQLITE_OK, let opened = handle else {
+            let message = handle.map { String(cString: sqlite3_errmsg($0)) } ?? "out of memory"
+            sqlite3_close(handle)
+            throw CallHistoryStoreError.sqlite(code: rc, message: message)
+        }
+        db = opened
+        // Once db is set, a failure below still goes through deinit which closes it.
+        try exec("PRAGMA journal_mode = WAL")
+        try exec("PRAGMA synchronous = NORMAL")
+        try exec("""
+            CREATE TABLE IF NOT EXISTS call_history (
+                id INTEGER PRIMARY KEY AUTOINCREMENT,
+                call_id TEXT NOT NULL UNIQUE,
+                ref_key TEXT,
+                remote_address TEXT,
+                local_address TEXT,
+                direction INTEGER NOT NULL,
+                status INTEGER NOT NULL,
+                start_date INTEGER NOT NULL,
+                duration INTEGER NOT NULL,
+                quality REAL NOT NULL,
+                video_enabled INTEGER NOT NULL
+            )
+            """)
+        try exec("CREATE INDEX IF NOT EXISTS call_history_ref_key ON call_history(ref_key) WHERE ref_key IS NOT NULL")
+        try exec("CREATE INDEX IF NOT EXISTS call_history_date ON call_history(start_date DESC, id DESC)")
+        try exec("CREATE INDEX IF NOT EXISTS call_history_remote ON call_history(remote_address, start_date DESC, id DESC)")
+        try exec("CREATE INDEX IF NOT EXISTS call_history_status ON call_history(status, direction, start_date)")
+    }
+
+    deinit {
+        statements.values.forEach { sqlite3_finalize($0) }
+        sqlite3_close(db)
+    }
+
+    public func setLogger(_ logger: Logger) {
+        self.logger = logger
+    }
+
+    /*
+     * Imports the current history of the core and keeps the index up to date with
+     * new call logs until the store is released.
+     */
+    public func attach(core: Core) {
+        self.core?.removeDelegate(delegate: self)
+        self.core = core
+        core.addDelegate(delegate: self)
+        rebuild()
+    }
+
+    public func detach() {
+        core?.removeDelegate(delegate: self)
+        core = nil
+    }
+
+    /*
+     * Drops the index and imports the core history again. Use it after the application
+     * removed call logs from the core (clearCallLogs, removeCallLog).
+     */
+    public func rebuild() {
+        guard let logs = core?.callLogs else {
+            return
+        }
+        queue.sync {
+            do {
+                try exec("BEGIN IMMEDIATE")
+                try exec("DELETE FROM call_history")
+                for log in logs {
+                    try upsert(log: log)
+                }
+                try exec("COMMIT")
+            } catch {
+                _ = try? exec("ROLLBACK")
+                logger?.error("[CallHistoryStore] Import of \(logs.count) call logs failed: \(error)")
+            }
+        }
+    }
+
+    public func onCallLogUpdated(core: Core, callLog: CallLog) {
+        index(callLog: callLog)
+    }
+
+    /*
+     * Sets the persistent reference key of a call log and indexes it.
+     */
+    public func setRefKey(_ refKey: String, for callLog: CallLog) {
+        callLog.refKey = refKey
+        index(callLog: callLog)
+    }
+
+    public func index(callLog: CallLog) {
+        queue.sync {
+            do {
+                try upsert(log: callLog)
+            } catch {
+                logger?.error("[CallHistoryStore] Cannot index call log [\(callLog.callId)]: \(error)")
+            }
+        }
+    }
+
+    public func remove(callId: String) {
+        queue.sync {
+            _ = try? run("DELETE FROM call_history WHERE call_id = ?", [callId])
+        }
+    }
+
+    public func callLog(for entry: CallHistoryEntry) -> CallLog? {
+        return core?.findCallLogFromCallId(callId: entry.callId)
+    }
+
+    // Lookups
+
+    public func entry(callId: String) -> CallHistoryEntry? {
+        return select("SELECT * FROM call_history WHERE call_id = ?", [callId]).first
+    }
+
+    public func entry(refKey: String) -> CallHistoryEntry? {
+        return select("SELECT * FROM call_history WHERE ref_key = ? ORDER BY start_date DESC, id DESC LIMIT 1", [refKey]).first
+    }
+
+    public func lastOutgoing() -> CallHistoryEntry? {
+        return select("SELECT * FROM call_history WHERE direction = ? ORDER BY start_date DESC, id DESC LIMIT 1", [Call.Dir.Outgoing.rawValue]).first
+    }
+
+    /*
+     * Returns one page of history, most recent first. Pass the cursor of the previous page
+     * to continue; a nil cursor in the result means there is nothing left.
+     */
+    public func page(_ query: CallHistoryQuery, after cursor: CallHistoryCursor? = nil) -> (entries: [CallHistoryEntry], next: CallHistoryCursor?) {
+        var (clauses, args) = filter(query)
+        if let cursor = cursor {
+            clauses.append("(start_date < ? OR (start_date = ? AND id < ?))")
+            args.append(contentsOf: [Int64(cursor.startDate), Int64(cursor.startDate), cursor.rowId])
+        }
+        let limit = max(query.limit, 1)
+        var sql = "SELECT * FROM call_history"
+        if !clauses.isEmpty {
+            sql += " WHERE " + clauses.joined(separator: " AND ")
+        }
+        sql += " ORDER BY start_date DESC, id DESC LIMIT \(limit)"
+        let entries = select(sql, args)
+        let next = entries.count == limit ? entries.last.map { CallHistoryCursor(startDate: $0.startDate, rowId: $0.rowId) } : nil
+        return (entries, next)
+    }
+
+    // Aggregates
+
+    public func count(_ query: CallHistoryQuery) -> Int {
+        let (clauses, args) = filter(query)
+        var sql = "SELECT COUNT(*) FROM call_history"
+        if !clauses.isEmpty {
+            sql += " WHERE " + clauses.joined(separator: " AND ")
+        }
+        return queue.sync {
+            (try? scalar(sql, args)).map { Int($0) } ?? 0
+        }
+    }
+
+    public func missedCallsCount(since: time_t) -> Int {
+        var query = CallHistoryQuery()
+        query.dir = .Incoming
+        query.statuses = [.Missed]
+        query.since = since
+        return count(query)
+    }
+
+    // SQLite helpers, to be called on queue
+
+    func filter(_ query: CallHistoryQuery) -> ([String], [Any]) {
+        var clauses: [String] = []
+        var args: [Any] = []
+        if let dir = query.dir {
+            clauses.append("direction = ?")
+            args.append(dir.rawValue)
+        }
+        if let statuses = query.statuses, !statuses.isEmpty {
+            clauses.append("status IN (" + statuses.map { _ in "?" }.joined(separator: ",") + ")")
+            args.append(contentsOf: statuses.map { $0.rawValue as Any })
+        }
+        if let address = query.remoteAddress {
+            clauses.append("remote_address = ?")
+            args.append(address.asStringUriOnly())
+        }
+        if let since = query.since {
+            clauses.append("start_date >= ?")
+            args.append(Int64(since))
+        }
+        if let until = query.until {
+            clauses.append("start_date < ?")
+            args.append(Int64(until))
+        }
+        return (clauses, args)
+    }
+
+    func upsert(log: CallLog) throws {
+        let refKey = log.refKey
+        try run("""
+            INSERT INTO call_history (call_id, ref_key, remote_address, local_address, direction, status, start_date, duration, quality, video_enabled)
+            VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
+            ON CONFLICT(call_id) DO UPDATE SET
+                ref_key = excluded.ref_key, remote_address = excluded.remote_address, local_address = excluded.local_address,
+                direction = excluded.direction, status = excluded.status, start_date = excluded.start_date,
+                duration = excluded.duration, quality = excluded.quality, video_enabled = excluded.video_enabled
+            """, [
+                log.callId,
+                refKey.isEmpty ? nil : refKey,
+                log.remoteAddress?.asStringUriOnly(),
+                log.localAddress?.asStringUriOnly(),
+                log.dir.rawValue,
+                log.status.rawValue,
+                Int64(log.startDate),
+                log.duration,
+                Double(log.quality),
+                log.videoEnabled
+            ] as [Any?])
+    }
+
+    func select(_ sql: String, _ args: [Any?]) -> [CallHistoryEntry] {
+        return queue.sync {
+            var entries: [CallHistoryEntry] = []
+            do {
+                let stmt = try prepare(sql, args)
+                defer { sqlite3_reset(stmt) }
+                while sqlite3_step(stmt) == SQLITE_ROW {
+                    entries.append(CallHistoryEntry(
+                        rowId: sqlite3_column_int64(stmt, 0),
+                        callId: text(stmt, 1) ?? "",
+                        refKey: text(stmt, 2),
+                        remoteAddress: text(stmt, 3),
+                        localAddress: text(stmt, 4),
+                        dir: Call.Dir(rawValue: Int(sqlite3_column_int(stmt, 5))) ?? .Outgoing,
+                        status: Call.Status(rawValue: Int(sqlite3_column_int(stmt, 6))) ?? .Success,
+                        startDate: time_t(sqlite3_column_int64(stmt, 7)),
+                        duration: Int(sqlite3_column_int64(stmt, 8)),
+                        quality: Float(sqlite3_column_double(stmt, 9)),
+                        videoEnabled: sqlite3_column_int(stmt, 10) != 0))
+                }
+            } catch {
+                logger?.error("[CallHistoryStore] Query failed: \(error)")
+            }
+            return entries
+        }
+    }
+
+    func scalar(_ sql: String, _ args: [Any?]) throws -> Int64 {
+        let stmt = try prepare(sql, args)
+        defer { sqlite3_reset(stmt) }
+        guard sqlite3_step(stmt) == SQLITE_ROW else {
+            throw lastError()
+        }
+        return sqlite3_column_int64(stmt, 0)
+    }
+
+    func run(_ sql: String, _ args: [Any?]) throws {
+        let stmt = try prepare(sql, args)
+        defer { sqlite3_reset(stmt) }
+        if sqlite3_step(stmt) != SQLITE_DONE {
+            throw lastError()
+        }
+    }
+
+    func exec(_ sql: String) throws {
+        if sqlite3_exec(db, sql, nil, nil, nil) != SQLITE_OK {
+            throw lastError()
+        }
+    }
+
+    /*
+     * Statements are cached by their SQL text, queries only differ by their bindings.
+     * Filtered queries build their WHERE clause from the filter fields set, so the cache
+     * keeps the most recently used statements only and finalizes the others.
+     */
+    func prepare(_ sql: String, _ args: [Any?]) throws -> OpaquePointer {
+        var stmt = statements[sql]
+        if stmt == nil {
+            if sqlite3_prepare_v3(db, sql, -1, UInt32(SQLITE_PREPARE_PERSISTENT), &stmt, nil) != SQLITE_OK {
+                throw lastError()
+            }
+            if statementsOrder.count >= CallHistoryStore.maxStatements {
+                let evicted = statementsOrder.removeFirst()
+                sqlite3_finalize(statements.removeValue(forKey: evicted))
+            }
+            statements[sql] = stmt
+        } else if let index = statementsOrder.firstIndex(of: sql) {
+            statementsOrder.remove(at: index)
+        }
+        statementsOrder.append(sql)
+        sqlite3_clear_bindings(stmt)
+        for (i, arg) in args.enumerated() {
+            let index = Int32(i + 1)
+            switch arg {
+            case let value as String:
+                sqlite3_bind_text(stmt, index, value, -1, CallHistoryStore.transient)
+            case let value as Int:
+                sqlite3_bind_int64(stmt, index, Int64(value))
+            case let value as Int64:
+                sqlite3_bind_int64(stmt, index, value)
+            case let value as Double:
+                sqlite3_bind_double(stmt, index, value)
+            case let value as Bool:
+                sqlite3_bind_int(stmt, index, value ? 1 : 0)
+            default:
+                sqlite3_bind_null(stmt, index)
+            }
+        }
+        return stmt!
+    }
+
+    func text(_ stmt: OpaquePointer, _ column: Int32) -> String? {
+        guard let value = sqlite3_column_text(stmt, column) else {
+            return nil
+        }
+        return String(cString: value)
+    }
+
+    func lastError() -> CallHistoryStoreError {
+        return CallHistoryStoreError.sqlite(code: sqlite3_errcode(db), message: String(cString: sqlite3_errmsg(db)))
+    }
+
+    static let transient = unsafeBitCast(-1, to: sqlite3_destructor_type.self)
+}
@@ -0,0 +1,405 @@
+/*
+ * Copyright (c) 2010-2020 Belledonne Communications SARL.
+ *
+ * This file is part of linphone-iphone
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+import Foundation
+import Compression
+import os
+import linphonesw
+import LogRing
+
+public struct LogCollectorStats {
+    /// Bytes of log text handed to the compressor.
+    public var bytes: UInt64 = 0
+    /// Bytes written to the segments, after compression.
+    public var compressedBytes: UInt64 = 0
+    public var lines: UInt64 = 0
+    /// Lines dropped because the buffer was full when they were produced, or because writing them failed.
+    public var droppedLines: UInt64 = 0
+    public var segments: Int = 0
+    /// Segments abandoned because writing or compressing into them failed.
+    public var writeErrors: UInt64 = 0
+    /// Age of the oldest line the writer had not written yet when it last woke up, in seconds.
+    public var writerLag: TimeInterval = 0
+}
+
+/*
+ * LogCollector replaces the SDK log collection with an asynchronous one.
+ * The SDK log collection formats and writes every line on the thread that logs it, which shows
+ * up as late ticks of the media ticker at debug level. Here the logging thread only copies the
+ * record into a bounded lock-free ring; a background thread formats the lines, gzip-compresses them
+ * into rotating segments and updates the stats. When the ring is full, lines are dropped and counted
+ * instead of blocking the producer.
+ */
+public class LogCollector: LoggingServiceDelegate {
+    // A class, so that the ring can hold it as a retained pointer.
+    final class Record {
+        let date: TimeInterval
+        let domain: String
+        let level: LogLevel
+        let message: String
+
+        init(date: TimeInterval, domain: String, level: LogLevel, message: String) {
+            self.date = date
+            self.domain = domain
+            self.level = level
+            self.message = message
+        }
+    }
+
+    let directory: URL
+    let prefix: String
+    let maxSegmentSize: Int
+    let maxSegments: Int
+
+    let ring: OpaquePointer
+    // Only guards the stats and the running flag, between the writer and the callers of
+    // getStats() and stop(). Producers never take it.
+    // os_unfair_lock must not move, so it is not stored inline in the object.
+    let lock = UnsafeMutablePointer<os_unfair_lock>.allocate(capacity: 1)
+    var running = false
+    let wakeup = DispatchSemaphore(value: 0)
+    let done = DispatchSemaphore(value: 0)
+
+    var stats = LogCollectorStats()
+    var segment: GzipSegment? = nil
+    let dateFormatter = DateFormatter()
+
+    public init(directory: URL, prefix: String = "linphone", maxSegmentSize: Int = 2 * 1024 * 1024, maxSegments: Int = 5, capacity: Int = 8192) {
+        self.directory = directory
+        self.prefix = prefix
+        self.maxSegmentSize = maxSegmentSize
+        self.maxSegments = maxSegments
+        ring = log_ring_new(max(capacity, 64))
+        dateFormatter.dateFormat = "yyyy-MM-dd HH:mm:ss:SSS"
+        dateFormatter.locale = Locale(identifier: "en_US_POSIX")
+        lock.initialize(to: os_unfair_lock())
+    }
+
+    deinit {
+        while let item = log_ring_pop(ring) {
+            Unmanaged<Record>.fromOpaque(item).release()
+        }
+        log_ring_destroy(ring)
+        lock.deinitialize(count: 1)
+        lock.deallocate()
+    }
+
+    /*
+     * Disables the SDK log collection and starts collecting through the logging service.
+     */
+    public func start() {
+        if running {
+            return
+        }
+        running = true
+        try? FileManager.default.createDirectory(at: directory, withIntermediateDirectories: true)
+        Core.enableLogCollection(state: .Disabled)
+        let thread = Thread { [weak self] in self?.writerLoop() }
+        thread.name = "linphonesw.logcollector"
+        thread.qualityOfService = .utility
+        thread.start()
+        LoggingService.Instance.addDelegate(delegate: self)
+    }
+
+    /*
+     * Stops collecting, writes what is still buffered and closes the current segment.
+     */
+    public func stop() {
+        if !running {
+            return
+        }
+        LoggingService.Instance.removeDelegate(delegate: self)
+        os_unfair_lock_lock(lock)
+        running = false
+        os_unfair_lock_unlock(lock)
+        wakeup.signal()
+        done.wait()
+    }
+
+    public func getStats() -> LogCollectorStats {
+        os_unfair_lock_lock(lock)
+        var current = stats
+        current.droppedLines = log_ring_dropped(ring)
+        os_unfair_lock_unlock(lock)
+        return current
+    }
+
+    /*
+     * Segments in writing order, the last one may still be open.
+     */
+    public func segmentFiles() -> [URL] {
+        return (1...maxSegments).map { segmentUrl(index: $0) }.filter { FileManager.default.fileExists(atPath: $0.path) }.reversed()
+    }
+
+    public func onLogMessageWritten(logService: LoggingService, domain: String, level: LogLevel, message: String) {
+        let record = Record(date: Date().timeIntervalSince1970, domain: domain, level: level, message: message)
+        let item = Unmanaged.passRetained(record)
+        var count = 0
+        if !log_ring_push(ring, item.toOpaque(), &count) {
+            // Counted as dropped by the ring.
+            item.release()
+            return
+        }
+        // The writer polls on its own, only wake it up early when the ring starts filling up.
+        if count == log_ring_capacity(ring) / 2 {
+            wakeup.signal()
+        }
+    }
+
+    // Writer thread
+
+    func writerLoop() {
+        var batch: [Record] = []
+        batch.reserveCapacity(log_ring_capacity(ring))
+        var stopping = false
+        while !stopping {
+            _ = wakeup.wait(timeout: .now() + .milliseconds(250))
+            os_unfair_lock_lock(lock)
+            stopping = !running
+            os_unfair_lock_unlock(lock)
+            // Popped after reading the running flag, so that the last pass gets the lines logged before stop().
+            while let item = log_ring_pop(ring) {
+                batch.append(Unmanaged<Record>.fromOpaque(item).takeRetainedValue())
+            }
+            if let oldest = batch.first {
+                os_unfair_lock_lock(lock)
+                stats.writerLag = Date().timeIntervalSince1970 - oldest.date
+                os_unfair_lock_unlock(lock)
+            }
+
+            if !batch.isEmpty {
+                write(batch)
+                batch.removeAll(keepingCapacity: true)
+            }
+        }
+        segment?.close()
+        segment = nil
+        done.signal()
+    }
+
+    func write(_ batch: [Record]) {
+        var text = ""
+        for record in batch {
+            text += dateFormatter.string(from: Date(timeIntervalSince1970: record.date))
+            text += " \(record.domain)-\(levelName(record.level)) \(record.message)\n"
+        }
+        let data = Data(text.utf8)
+        if segment == nil {
+            segment = openSegment()
+        }
+        guard let current = segment else {
+            log_ring_add_dropped(ring, UInt64(batch.count))
+            return
+        }
+        let written: Int
+        do {
+            written = try current.write(data)
+        } catch {
+            // The segment is unusable past a failed write, the next batch starts a new one.
+            NSLog("LogCollector: dropping \(batch.count) lines, writing \(segmentUrl(index: 1).lastPathComponent) failed: \(error)")
+            current.close()
+            segment = nil
+            log_ring_add_dropped(ring, UInt64(batch.count))
+            os_unfair_lock_lock(lock)
+            stats.writeErrors += 1
+            os_unfair_lock_unlock(lock)
+            return
+        }
+        let rotate = current.compressedSize >= maxSegmentSize
+        if rotate {
+            current.close()
+            segment = nil
+        }
+
+        os_unfair_lock_lock(lock)
+        stats.bytes += UInt64(data.count)
+        stats.compressedBytes += UInt64(written)
+        stats.lines += UInt64(batch.count)
+        os_unfair_lock_unlock(lock)
+    }
+
+    func openSegment() -> GzipSegment? {
+        // Segment 1 is the current one, older ones are shifted up and the oldest is removed.
+        let fileManager = FileManager.default
+        try? fileManager.removeItem(at: segmentUrl(index: maxSegments))
+        if maxSegments > 1 {
+            for index in stride(from: maxSegments - 1, through: 1, by: -1) {
+                try? fileManager.moveItem(at: segmentUrl(index: index), to: segmentUrl(index: index + 1))
+            }
+        }
+        let segment = GzipSegment(url: segmentUrl(index: 1))
+        if segment != nil {
+            os_unfair_lock_lock(lock)
+            stats.segments += 1
+            os_unfair_lock_unlock(lock)
+        }
+        return segment
+    }
+
+    func segmentUrl(index: Int) -> URL {
+        return directory.appendingPathComponent("\(prefix)\(index).log.gz")
+    }
+
+    func levelName(_ level: LogLevel) -> String {
+        switch level {
+        case .Debug: return "debug"
+        case .Trace: return "trace"
+        case .Message: return "message"
+        case .Warning: return "warning"
+        case .Error: return "error"
+        case .Fatal: return "fatal"
+        default: return "unknown"
+        }
+    }
+}
+
+enum GzipSegmentError: Error {
+    case compressionFailed
+}
+
+/*
+ * A gzip file written as a single deflate stream, so that segments can be read back
+ * with the usual tools while being compressed incrementally.
+ */
+class GzipSegment {
+    let handle: FileHandle
+    let stream = UnsafeMutablePointer<compression_stream>.allocate(capacity: 1)
+    let buffer = UnsafeMutablePointer<UInt8>.allocate(capacity: 64 * 1024)
+    let bufferSize = 64 * 1024
+    var crc: UInt32 = 0xffffffff
+    var size: UInt32 = 0
+    var compressedSize = 0
+    var closed = false
+
+    init?(url: URL) {
+        guard FileManager.default.createFile(atPath: url.path, contents: nil),
+              let handle = try? FileHandle(forWritingTo: url),
+              compression_stream_init(stream, COMPRESSION_STREAM_ENCODE, COMPRESSION_ZLIB) == COMPRESSION_STATUS_OK else {
+            stream.deallocate()
+            buffer.deallocate()
+            return nil
+        }
+        self.handle = handle
+        // Header: magic, deflate, no flags, no mtime, no extra flags, unknown OS.
+        let header: [UInt8] = [0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff]
+        do {
+            try append(Data(header))
+        } catch {
+            close()
+            return nil
+        }
+        compressedSize = header.count
+    }
+
+    deinit {
+        // A segment dropped without close() still owns the encoder state.
+        if !closed {
+            compression_stream_destroy(stream)
+        }
+        stream.deallocate()
+        buffer.deallocate()
+    }
+
+    /* Returns the number of compressed bytes written to the file. */
+    @discardableResult
+    func write(_ data: Data) throws -> Int {
+        let before = compressedSize
+        try data.withUnsafeBytes { (raw: UnsafeRawBufferPointer) in
+            guard let base = raw.bindMemory(to: UInt8.self).baseAddress else {
+                return
+            }
+            crc = GzipSegment.crc32(crc, base, raw.count)
+            size = size &+ UInt32(truncatingIfNeeded: raw.count)
+            stream.pointee.src_ptr = base
+            stream.pointee.src_size = raw.count
+            try process(finalize: false)
+        }
+        return compressedSize - before
+    }
+
+    /* Writes the trailer and closes the file, a segment whose writes failed is left truncated. */
+    func close() {
+        if closed {
+            return
+        }
+        closed = true
+        defer {
+            compression_stream_destroy(stream)
+            try? handle.close()
+        }
+        var trailer = Data()
+        withUnsafeBytes(of: (~crc).littleEndian) { trailer.append(contentsOf: $0) }
+        withUnsafeBytes(of: size.littleEndian) { trailer.append(contentsOf: $0) }
+        do {
+            try process(finalize: true)
+            try append(trailer)
+            compressedSize += trailer.count
+        } catch {
+            // Nothing more can be written, the segment stays truncated.
+        }
+    }
+
+    func append(_ data: Data) throws {
+        if #available(iOS 13.4, *) {
+            try handle.write(contentsOf: data)
+        } else {
+            handle.write(data)
+        }
+    }
+
+    func process(finalize: Bool) throws {
+        let flags = finalize ? Int32(COMPRESSION_STREAM_FINALIZE.rawValue) : 0
+        while true {
+            stream.pointee.dst_ptr = buffer
+            stream.pointee.dst_size = bufferSize
+            let status = compression_stream_process(stream, flags)
+            let produced = bufferSize - stream.pointee.dst_size
+            if produced > 0 {
+                try append(Data(bytes: buffer, count: produced))
+                compressedSize += produced
+            }
+            if status == COMPRESSION_STATUS_ERROR {
+                throw GzipSegmentError.compressionFailed
+            }
+            if status == COMPRESSION_STATUS_END {
+                return
+            }
+            // Without finalize, the encoder only stops once it consumed the input and has room left.
+            if !finalize && stream.pointee.src_size == 0 && stream.pointee.dst_size > 0 {
+                return
+            }
+        }
+    }
+
+    static let crcTable: [UInt32] = (0..<256).map { (n: Int) -> UInt32 in
+        var c = UInt32(n)
+        for _ in 0..<8 {
+            c = (c & 1) != 0 ? (0xedb88320 ^ (c >> 1)) : (c >> 1)
+        }
+        return c
+    }
+
+    static func crc32(_ crc: UInt32, _ bytes: UnsafePointer<UInt8>, _ count: Int) -> UInt32 {
+        var c = crc
+        for i in 0..<count {
+            c = crcTable[Int((c ^ UInt32(bytes[i])) & 0xff)] ^ (c >> 8)
+        }
+        return c
+    }
+}
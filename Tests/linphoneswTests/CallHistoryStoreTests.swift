@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2010-2020 Belledonne Communications SARL.
+ *
+ * This file is part of linphone-iphone
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+import XCTest
+@testable import linphonesw
+
+/*
+ * Benchmark of the call history index with 500k call logs, against a walk of the
+ * whole history as linphone_core_find_call_log() and the list based getters do.
+ * The rows are inserted directly, the store needs no core for queries.
+ */
+final class CallHistoryStoreTests: XCTestCase {
+    static let logCount = 500_000
+    static let baseDate: time_t = 1_600_000_000
+    static var store: CallHistoryStore!
+    static var history: [(callId: String, refKey: String?, dir: Int, status: Int, startDate: time_t)] = []
+
+    override class func setUp() {
+        super.setUp()
+        let path = NSTemporaryDirectory() + "call_history_benchmark.db"
+        for suffix in ["", "-wal", "-shm"] {
+            try? FileManager.default.removeItem(atPath: path + suffix)
+        }
+        store = try! CallHistoryStore(path: path)
+        history.reserveCapacity(logCount)
+        for i in 0..<logCount {
+            history.append((callId: "call-\(i)", refKey: i % 10 == 0 ? "ref-\(i)" : nil, dir: i % 2,
+                            status: i % 7 == 0 ? Call.Status.Missed.rawValue : Call.Status.Success.rawValue,
+                            startDate: baseDate + time_t(i * 60)))
+        }
+        let start = Date()
+        store.queue.sync {
+            try! store.exec("BEGIN IMMEDIATE")
+            for log in history {
+                try! store.run("""
+                    INSERT INTO call_history (call_id, ref_key, remote_address, local_address, direction, status, start_date, duration, quality, video_enabled)
+                    VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
+                    """, [log.callId, log.refKey, "sip:user\(log.startDate % 1000)@example.org", "sip:me@example.org",
+                          log.dir, log.status, Int64(log.startDate), 60, 4.5, false] as [Any?])
+            }
+            try! store.exec("COMMIT")
+        }
+        print("[CallHistoryStoreTests] \(logCount) call logs indexed in \(Int(Date().timeIntervalSince(start) * 1000)) ms")
+    }
+
+    override class func tearDown() {
+        store = nil
+        history = []
+        super.tearDown()
+    }
+
+    var randomCallIds: [String] {
+        var generator = SystemRandomNumberGenerator()
+        return (0..<1000).map { _ in "call-\(Int.random(in: 0..<CallHistoryStoreTests.logCount, using: &generator))" }
+    }
+
+    func testLookupByCallId() {
+        let store = CallHistoryStoreTests.store!
+        let callIds = randomCallIds
+        measure {
+            for callId in callIds {
+                XCTAssertEqual(store.entry(callId: callId)?.callId, callId)
+            }
+        }
+    }
+
+    func testLookupByCallIdWalkingTheHistory() {
+        let history = CallHistoryStoreTests.history
+        let callIds = Array(randomCallIds.prefix(100))
+        measure {
+            for callId in callIds {
+                XCTAssertNotNil(history.first { $0.callId == callId })
+            }
+        }
+    }
+
+    func testLookupByRefKey() {
+        let store = CallHistoryStoreTests.store!
+        measure {
+            for i in stride(from: 0, to: CallHistoryStoreTests.logCount, by: 500) {
+                XCTAssertEqual(store.entry(refKey: "ref-\(i)")?.callId, "call-\(i)")
+            }
+        }
+    }
+
+    func testPagedMissedCalls() {
+        let store = CallHistoryStoreTests.store!
+        var query = CallHistoryQuery()
+        query.dir = .Incoming
+        query.statuses = [.Missed]
+        query.limit = 50
+        measure {
+            var cursor: CallHistoryCursor? = nil
+            var previous: time_t = .max
+            for _ in 0..<100 {
+                let page = store.page(query, after: cursor)
+                XCTAssertEqual(page.entries.count, 50)
+                for entry in page.entries {
+                    XCTAssertTrue(entry.startDate < previous)
+                    previous = entry.startDate
+                }
+                cursor = page.next
+            }
+        }
+    }
+
+    func testMissedCallsCount() {
+        let store = CallHistoryStoreTests.store!
+        let since = CallHistoryStoreTests.baseDate + time_t(CallHistoryStoreTests.logCount / 2 * 60)
+        let expected = CallHistoryStoreTests.history.filter {
+            $0.dir == Call.Dir.Incoming.rawValue && $0.status == Call.Status.Missed.rawValue && $0.startDate >= since
+        }.count
+        measure {
+            XCTAssertEqual(store.missedCallsCount(since: since), expected)
+        }
+    }
+
+    func testMissedCallsCountWalkingTheHistory() {
+        let history = CallHistoryStoreTests.history
+        let since = CallHistoryStoreTests.baseDate + time_t(CallHistoryStoreTests.logCount / 2 * 60)
+        measure {
+            XCTAssertTrue(history.filter {
+                $0.dir == Call.Dir.Incoming.rawValue && $0.status == Call.Status.Missed.rawValue && $0.startDate >= since
+            }.count > 0)
+        }
+    }
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2010-2020 Belledonne Communications SARL.
+ *
+ * This file is part of linphone-iphone
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+import XCTest
+@testable import linphonesw
+
+/*
+ * Tests of LogCollector, and benchmark of the cost of a log line on the producing thread
+ * with the SDK log collection and with the collector.
+ */
+final class LogCollectorTests: XCTestCase {
+    static let linesPerRun = 10_000
+    static let message = "ms_ticker_run: ticker late: 12 ms, sending RTP packet of 172 bytes on stream 0x7f00beef"
+
+    var directory: URL!
+
+    override func setUp() {
+        super.setUp()
+        directory = URL(fileURLWithPath: NSTemporaryDirectory()).appendingPathComponent("log_collector_\(name.hashValue)")
+        try? FileManager.default.removeItem(at: directory)
+        LoggingService.Instance.logLevel = .Message
+    }
+
+    override func tearDown() {
+        Core.enableLogCollection(state: .Disabled)
+        try? FileManager.default.removeItem(at: directory)
+        super.tearDown()
+    }
+
+    func log(_ collector: LogCollector, count: Int) {
+        for _ in 0..<count {
+            collector.onLogMessageWritten(logService: LoggingService.Instance, domain: "mediastreamer", level: .Message, message: LogCollectorTests.message)
+        }
+    }
+
+    func testDropsWhenFull() {
+        // Not started: nothing drains the ring.
+        let collector = LogCollector(directory: directory, capacity: 64)
+        log(collector, count: 100)
+        XCTAssertEqual(collector.getStats().droppedLines, 36)
+    }
+
+    func testWritesGzipSegments() throws {
+        let collector = LogCollector(directory: directory, maxSegmentSize: 16 * 1024, maxSegments: 3)
+        collector.start()
+        log(collector, count: 50_000)
+        collector.stop()
+
+        let stats = collector.getStats()
+        // The SDK may log on its own meanwhile.
+        XCTAssertGreaterThanOrEqual(stats.lines, 50_000)
+        XCTAssertEqual(stats.droppedLines, 0)
+        XCTAssertEqual(stats.writeErrors, 0)
+        XCTAssertGreaterThan(stats.segments, 1)
+        XCTAssertLessThan(stats.compressedBytes, stats.bytes)
+
+        let files = collector.segmentFiles()
+        XCTAssertEqual(files.count, 3)
+        for file in files {
+            let data = try Data(contentsOf: file)
+            XCTAssertEqual(Array(data.prefix(3)), [0x1f, 0x8b, 0x08])
+        }
+    }
+
+    func testProducerCostWithCollector() {
+        let collector = LogCollector(directory: directory, capacity: 1 << 16)
+        collector.start()
+        measure {
+            log(collector, count: LogCollectorTests.linesPerRun)
+        }
+        collector.stop()
+        XCTAssertEqual(collector.getStats().droppedLines, 0)
+    }
+
+    func testLoggingServiceCostWithCollector() {
+        let collector = LogCollector(directory: directory, capacity: 1 << 16)
+        collector.start()
+        measure {
+            for _ in 0..<LogCollectorTests.linesPerRun {
+                LoggingService.Instance.message(message: LogCollectorTests.message)
+            }
+        }
+        collector.stop()
+    }
+
+    func testLoggingServiceCostWithSdkLogCollection() {
+        try? FileManager.default.createDirectory(at: directory, withIntermediateDirectories: true)
+        Core.setLogCollectionPath(path: directory.path)
+        Core.enableLogCollection(state: .Enabled)
+        measure {
+            for _ in 0..<LogCollectorTests.linesPerRun {
+                LoggingService.Instance.message(message: LogCollectorTests.message)
+            }
+        }
+    }
+}